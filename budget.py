@@ -0,0 +1,450 @@
+#!/usr/bin/env python3
+"""
+Flash, cycle and stack budget of the firmware - parses disassembly of the ELF (avr-objdump -d -l)
+and reports per function: bytes, worst-case path in cycles (longest path through its control flow,
+cycles of called functions included) and stack usage, then worst-case stack depth against sram and
+worst-case interrupt latency. Path of a function with loop (or indirect call, recursion) is counted
+with one pass through every loop, so it is not a bound - it is marked by '+'.
+Bytes are reported also per source function, where instructions are assigned by their line info,
+so also inlined ones (battcheck, NextMode, ...) show up.
+
+Result is compared with baseline (rukolamp.budget, created when missing, --update rewrites it),
+so it is visible what grew and by how much.
+
+usage: budget.py [--update] [--baseline FILE] [--flash BYTES] [--ram BYTES]
+                 [--disassembly FILE --sections FILE] <elf>
+       --update       write actual numbers as new baseline
+       --disassembly  saved output of objdump -d -l, --sections of objdump -h (used by test.sh)
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+OBJDUMP = os.environ.get("AVR_PREFIX", "avr-") + "objdump"
+
+# cycles of AVRe core (ATtiny), conditional branches and skips as taken (worst_paths counts both ways)
+CYCLES = {
+    "adiw": 2, "sbiw": 2, "cbi": 2, "sbi": 2,
+    "ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2, "push": 2, "pop": 2,
+    "rjmp": 2, "ijmp": 2, "jmp": 3, "rcall": 3, "icall": 3, "call": 4,
+    "lpm": 3, "ret": 4, "reti": 4,
+    "cpse": 2, "sbrc": 2, "sbrs": 2, "sbic": 2, "sbis": 2,
+}
+INTERRUPT_RESPONSE = 4  # push of PC and jump to vector
+RETURN_ADDRESS = 2      # bytes pushed by call or interrupt on parts up to 128kB
+
+LABEL_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+LINE_RE = re.compile(r"^(/?[^:\s][^:]*):(\d+)(?: \(discriminator \d+\))?$")
+TARGET_RE = re.compile(r"<([^>+]+)(\+0x[0-9a-f]+)?>")
+FUNC_RE = re.compile(r"^[A-Za-z_][\w\s\*]*?\b(\w+)\s*\([^;]*$")
+ISR_RE = re.compile(r"^ISR\s*\(\s*(\w+)")
+ATTRIBUTE_RE = re.compile(r"__attribute__\s*\(\(.*?\)\)")
+
+
+class Insn:
+    def __init__(self, addr, size, mnemonic, operands, comment, source):
+        self.addr = addr
+        self.size = size
+        self.mnemonic = mnemonic
+        self.operands = operands
+        self.comment = comment
+        self.source = source  # (file, line) or None
+        if mnemonic.startswith("br"):
+            self.cycles = 2
+        else:
+            self.cycles = CYCLES.get(mnemonic, 1)
+
+
+class Function:
+    def __init__(self, name, addr):
+        self.name = name
+        self.addr = addr
+        self.insns = []
+
+    def size(self):
+        return sum(i.size for i in self.insns)
+
+
+def objdump(args):
+    try:
+        return subprocess.run([OBJDUMP] + args, check=True, capture_output=True, text=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("budget.py: cannot run %s: %s" % (OBJDUMP, e))
+
+
+def saved(path):
+    if path is None:
+        return None
+    with open(path) as f:
+        return f.read()
+
+
+def parse_disassembly(text):
+    functions = []
+    source = None
+    for line in text.splitlines():
+        m = LABEL_RE.match(line)
+        if m:
+            functions.append(Function(m.group(2), int(m.group(1), 16)))
+            continue
+        m = LINE_RE.match(line)
+        if m:
+            source = (m.group(1), int(m.group(2)))
+            continue
+        parts = line.split("\t")
+        if len(parts) < 3 or not parts[0].strip().endswith(":") or not functions:
+            continue
+        try:
+            addr = int(parts[0].strip()[:-1], 16)
+        except ValueError:
+            continue
+        size = len(parts[1].split())
+        mnemonic = parts[2].strip()
+        operands = parts[3].strip() if len(parts) > 3 else ""
+        comment = parts[4].strip() if len(parts) > 4 else ""
+        if mnemonic.startswith("."):  # .word data in vectors etc.
+            continue
+        functions[-1].insns.append(Insn(addr, size, mnemonic, operands, comment, source))
+    return functions
+
+
+def parse_sections(text):
+    sizes = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) >= 3 and parts[0].isdigit():
+            sizes[parts[1]] = int(parts[2], 16)
+    return sizes
+
+
+def source_functions(path):
+    """Line ranges of top level functions in one source file: [(first, last, name)]"""
+    try:
+        with open(path, errors="replace") as f:
+            lines = f.read().splitlines()
+    except OSError:
+        return []
+    result = []
+    depth = 0
+    header = None
+    start = 0
+    in_comment = False
+    if_depths = []  # brace depth at every open #if, every branch starts again from it
+    for n, line in enumerate(lines, 1):
+        code = line
+        if in_comment:
+            if "*/" not in code:
+                continue
+            code = code.split("*/", 1)[1]
+            in_comment = False
+        code = re.sub(r"/\*.*?\*/", "", code)
+        if "/*" in code:
+            code, in_comment = code.split("/*", 1)[0], True
+        code = re.sub(r"//.*", "", code)
+        code = re.sub(r"'(\\.|[^'])'|\"(\\.|[^\"])*\"", "", code)
+        directive = code.strip().lstrip("#").split()[:1] if code.lstrip().startswith("#") else None
+        if directive is not None:
+            if directive and directive[0].startswith("if"):
+                if_depths.append(depth)
+            elif directive and directive[0] in ("else", "elif") and if_depths:
+                depth = if_depths[-1]
+            elif directive and directive[0] == "endif" and if_depths:
+                if_depths.pop()
+            continue
+        if depth == 0:
+            head = code.split("{", 1)[0]  # body of one line function has its own ';'
+            m = ISR_RE.match(head) or FUNC_RE.match(ATTRIBUTE_RE.sub("", head))
+            if m and m.group(1) not in ("if", "for", "while", "switch"):
+                header, start = m.group(1), n
+            elif code.strip() and "{" not in code and header and not code.strip().startswith(("{", ")")):
+                header = None
+        for ch in code:
+            if ch == "{":
+                depth += 1
+            elif ch == "}":
+                depth -= 1
+                if depth == 0 and header:
+                    result.append((start, n, header))
+                    header = None
+    return result
+
+
+def by_source_function(functions):
+    """bytes per source function, inlined copies included"""
+    ranges = {}
+    totals = {}
+    for f in functions:
+        for i in f.insns:
+            name = "(%s)" % f.name
+            if i.source:
+                path, line = i.source
+                if path not in ranges:
+                    ranges[path] = source_functions(path)
+                for first, last, fname in ranges[path]:
+                    if first <= line <= last:
+                        name = fname
+                        break
+            totals[name] = totals.get(name, 0) + i.size
+    return totals
+
+
+def call_target(insn):
+    m = TARGET_RE.search(insn.comment) or TARGET_RE.search(insn.operands)
+    if m and not m.group(2):
+        return m.group(1)
+    return None
+
+
+def own_stack(f):
+    """bytes pushed by the function itself (pushes and frame allocated on Y)"""
+    stack = 0
+    frame = False
+    for i in f.insns:
+        if i.mnemonic == "push":
+            stack += 1
+        elif i.mnemonic == "rcall" and i.operands.startswith(".+0"):
+            stack += RETURN_ADDRESS  # avr-gcc allocates 2 bytes by calling next instruction
+        elif i.mnemonic == "in" and i.operands.replace(" ", "") == "r28,0x3d":
+            frame = True
+        elif frame and i.mnemonic in ("sbiw", "subi") and i.operands.replace(" ", "").startswith("r28,"):
+            stack += int(i.operands.split(",")[1].split()[0], 0)
+            frame = False
+    return stack
+
+
+def stack_depths(functions):
+    table = {f.name: f for f in functions}
+    depth = {}
+    unknown = set()
+
+    def visit(name, active):
+        if name in depth:
+            return depth[name]
+        if name in active:
+            unknown.add(name + " (recursion)")
+            return 0
+        f = table[name]
+        deepest = 0
+        for i in f.insns:
+            target = call_target(i)
+            if i.mnemonic in ("icall", "ijmp"):
+                unknown.add(name + " (indirect call)")
+            elif i.mnemonic in ("rcall", "call") and target in table and not i.operands.startswith(".+0"):
+                deepest = max(deepest, RETURN_ADDRESS + visit(target, active | {name}))
+            elif i.mnemonic in ("rjmp", "jmp") and target in table and target != name:
+                deepest = max(deepest, visit(target, active | {name}))  # tail call
+        depth[name] = own_stack(f) + deepest
+        return depth[name]
+
+    for f in functions:
+        visit(f.name, frozenset())
+    return depth, unknown
+
+
+def cli_sections(functions, isrs):
+    """longest run of instructions with interrupts disabled by cli, per function: (cycles, has loop)"""
+    longest = (0, False, None)
+    for f in functions:
+        if f.name in isrs:
+            continue
+        start = None
+        cycles = 0
+        for n, i in enumerate(f.insns):
+            if i.mnemonic == "cli":
+                start, cycles = n, 0
+            elif start is not None:
+                cycles += i.cycles
+                if i.mnemonic in ("sei", "reti") or (i.mnemonic == "out" and i.operands.replace(" ", "").startswith("0x3f,")):
+                    loop = has_loop(f.insns[start:n + 1])
+                    if cycles > longest[0]:
+                        longest = (cycles, loop, f.name)
+                    start = None
+    return longest
+
+
+def jump_address(insn):
+    m = re.search(r"0x([0-9a-f]+)", insn.comment)
+    return int(m.group(1), 16) if m else None
+
+
+def has_loop(insns):
+    """any jump back to instruction of the same run"""
+    first = insns[0].addr if insns else 0
+    return any(call_target(j) is None and j.mnemonic.startswith(("br", "rjmp")) and
+               jump_address(j) is not None and first <= jump_address(j) <= j.addr
+               for j in insns)
+
+
+def worst_paths(functions):
+    """longest path through control flow of every function in cycles, called functions included:
+    {name: (cycles, notes)}, notes say why the number is not a bound (loop, indirect call, ...)"""
+    table = {f.name: f for f in functions}
+    result = {}
+
+    def callee(name, active, notes):
+        if name not in table:
+            notes.add("call of unknown %s" % name)
+            return 0
+        if name in active:
+            notes.add("recursion")
+            return 0
+        cycles, callee_notes = visit(name, active)
+        notes.update(callee_notes)
+        return cycles
+
+    def edges(f, n, active, notes):
+        """[(next instruction index or None for exit, cycles of this way)]"""
+        i = f.insns[n]
+        following = n + 1 if n + 1 < len(f.insns) else None
+        index = {j.addr: k for k, j in enumerate(f.insns)}
+        target = jump_address(i)
+        if i.mnemonic in ("ret", "reti"):
+            return [(None, i.cycles)]
+        if i.mnemonic in ("icall", "ijmp"):
+            notes.add("indirect call")
+            return [(None if i.mnemonic == "ijmp" else following, i.cycles)]
+        if i.mnemonic in ("rcall", "call"):
+            if i.operands.startswith(".+0"):  # frame allocation, see own_stack
+                return [(following, i.cycles)]
+            return [(following, i.cycles + callee(call_target(i), active, notes))]
+        if i.mnemonic in ("rjmp", "jmp"):
+            if target in index:
+                return [(index[target], i.cycles)]
+            return [(None, i.cycles + callee(call_target(i), active, notes))]  # tail call
+        if i.mnemonic.startswith("br"):
+            taken = (index[target], 2) if target in index else (None, 2 + callee(call_target(i), active, notes))
+            return [(following, 1), taken]
+        if i.mnemonic in ("cpse", "sbrc", "sbrs", "sbic", "sbis") and following is not None:
+            skipped = following + 1 if following + 1 < len(f.insns) else None
+            return [(following, 1), (skipped, 1 + f.insns[following].size // 2)]
+        return [(following, i.cycles)]
+
+    def visit(name, active):
+        if name in result:
+            return result[name]
+        f = table[name]
+        notes = set()
+        if has_loop(f.insns):
+            notes.add("loop")
+        longest = {}
+        on_path = set()
+
+        def walk(n):
+            on_path.add(n)
+            best = 0
+            for to, cycles in edges(f, n, active | {name}, notes):
+                if to is None:
+                    best = max(best, cycles)
+                elif to in on_path:
+                    notes.add("loop")  # back edge, loop is passed once
+                else:
+                    best = max(best, cycles + (longest[to] if to in longest else walk(to)))
+            on_path.discard(n)
+            longest[n] = best
+            return best
+
+        result[name] = (walk(0) if f.insns else 0, notes)
+        return result[name]
+
+    sys.setrecursionlimit(max(sys.getrecursionlimit(), 20000))
+    for f in functions:
+        visit(f.name, frozenset())
+    return result
+
+
+def path_text(path):
+    return "%d%s" % (path[0], "+" if path[1] else "")
+
+
+def read_baseline(path):
+    baseline = {}
+    try:
+        with open(path) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) == 4 and not line.startswith("#"):
+                    baseline[(parts[0], parts[1])] = (parts[2], parts[3])
+    except OSError:
+        return None
+    return baseline
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flash, cycle and stack budget of the firmware")
+    parser.add_argument("elf")
+    parser.add_argument("--baseline", default="rukolamp.budget")
+    parser.add_argument("--update", action="store_true", help="write actual numbers as new baseline")
+    parser.add_argument("--flash", type=int, default=1024)
+    parser.add_argument("--ram", type=int, default=64)
+    parser.add_argument("--disassembly", help="read saved output of objdump -d -l instead of running it")
+    parser.add_argument("--sections", help="read saved output of objdump -h instead of running it")
+    args = parser.parse_args()
+
+    functions = [f for f in parse_disassembly(saved(args.disassembly) or objdump(["-d", "-l", args.elf])) if f.insns]
+    sections = parse_sections(saved(args.sections) or objdump(["-h", args.elf]))
+    isrs = [f.name for f in functions if f.name.startswith("__vector_") and f.name != "__vector_default"]
+    depth, unknown = stack_depths(functions)
+    sources = by_source_function(functions)
+    paths = worst_paths(functions)
+
+    print("%-32s %6s %7s %6s" % ("symbol", "bytes", "cycles", "stack"))
+    for f in sorted(functions, key=lambda f: -f.size()):
+        notes = ", ".join(sorted(paths[f.name][1]))
+        print("%-32s %6d %7s %6d%s" % (f.name, f.size(), path_text(paths[f.name]), depth[f.name],
+                                       "  (" + notes + ")" if notes else ""))
+    print("cycles: worst-case path, called functions included, '+' = loop counted once, not a bound")
+
+    print()
+    print("%-32s %6s" % ("source function (incl. inlined)", "bytes"))
+    for name, size in sorted(sources.items(), key=lambda s: -s[1]):
+        print("%-32s %6d" % (name, size))
+
+    flash = sections.get(".text", 0) + sections.get(".data", 0)
+    static = sum(sections.get(s, 0) for s in (".data", ".bss", ".noinit"))
+    worst = depth.get("main", 0) + max([RETURN_ADDRESS + depth[i] for i in isrs] or [0])
+    print()
+    print("flash  %4d / %d bytes" % (flash, args.flash))
+    print("sram   %4d static + %d stack worst case (main %d + interrupt %d) / %d bytes, %d free"
+          % (static, worst, depth.get("main", 0), worst - depth.get("main", 0), args.ram, args.ram - static - worst))
+    for name in sorted(unknown):
+        print("       stack of %s is not counted" % name)
+
+    longest_insn = max((i.cycles for f in functions if f.name not in isrs for i in f.insns), default=0)
+    cli, loop, where = cli_sections(functions, isrs)
+    for isr in isrs:
+        latency = INTERRUPT_RESPONSE + 2 + longest_insn + cli
+        print("%-6s latency %d cycles worst case (response %d + vector rjmp 2 + instruction %d + cli section %d%s)"
+              % (isr, latency, INTERRUPT_RESPONSE, longest_insn, cli, " in " + where if where else ""))
+        if loop:
+            print("       cli section in %s contains a loop, its length is counted only once" % where)
+
+    current = {("source", name): (str(size), "-") for name, size in sources.items()}
+    current.update({("symbol", f.name): (str(f.size()), path_text(paths[f.name])) for f in functions})
+    current[("total", "flash")] = (str(flash), "-")
+    baseline = None if args.update else read_baseline(args.baseline)
+    if baseline is None:
+        with open(args.baseline, "w") as f:
+            f.write("# budget.py baseline: kind, name, bytes, worst-case path cycles\n")
+            for key in sorted(current):
+                f.write("%s %s %s %s\n" % (key + current[key]))
+        print("\nbaseline %s %s" % (args.baseline, "updated" if args.update else "created, commit it"))
+    else:
+        print("\nchanges against %s:" % args.baseline)
+        changed = False
+        for key in sorted(set(current) | set(baseline)):
+            old, new = baseline.get(key, ("0", "-")), current.get(key, ("0", "-"))
+            if old != new:
+                changed = True
+                print("%-6s %-32s %5s -> %5s bytes (%+d), %6s -> %6s cycles"
+                      % (key + (old[0], new[0], int(new[0]) - int(old[0]), old[1], new[1])))
+        if not changed:
+            print("none")
+
+    return 1 if flash > args.flash or static + worst > args.ram else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
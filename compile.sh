@@ -1,4 +1,12 @@
-MCU=attiny13a
+# processor is selected by MCU=attiny25 ./compile.sh, its traits are in targets.h
+MCU=${MCU:-attiny13a}
+case $MCU in
+	attiny13a) FLASH=1024; RAM=64; OUT=rukolamp;;
+	attiny25)  FLASH=2048; RAM=128; OUT=rukolamp-$MCU;;
+	attiny45)  FLASH=4096; RAM=256; OUT=rukolamp-$MCU;;
+	attiny85)  FLASH=8192; RAM=512; OUT=rukolamp-$MCU;;
+	*) echo "unsupported MCU $MCU"; exit 1;;
+esac
 
 # avr-c++ -mmcu=$MCU -Wall -g -gdwarf-2 -DF_CPU=16000000UL -O1 -ffreestanding -fno-tree-scev-cprop -mcall-prologues -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums -fno-jump-tables -fdata-sections -ffunction-sections -fwhole-program -Wl,--gc-sections -Wl,-u,vfprintf -lprintf_flt -lm -c medut.cpp -o medut.elf
 # avr-c++ -mmcu=$MCU -Wall -g -gdwarf-2 -DF_CPU=16000000UL -O1 -ffreestanding -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums -lm -c medut.cpp -o medut.elf
@@ -6,7 +14,7 @@ MCU=attiny13a
 CFLAGS="-Wall -W"
 #CLAGS+=" -pedantic"
 CFLAGS+=" -g3 -gdwarf-2 -gstrict-dwarf"
-CFLAGS+=" -DF_CPU=4800000UL -Os"
+CFLAGS+=" -Os"
 CFLAGS+=" -ffreestanding"
 #CFLAGS+=" -mshort-calls"
 #CFLAGS+=" -msize"
@@ -21,10 +29,18 @@ CFLAGS+=" -ffunction-sections"
 CFLAGS+=" -fdata-sections"
 CFLAGS+=" -Wl,--relax"
 CFLAGS+=" -Wa,-a,-ad"
-CFLAGS+=" -nostartfiles"
 
-avr-c++ -mmcu=$MCU $CFLAGS gcrt1.S rukolamp.c -o rukolamp.elf  > rukolamp.lst
+# stripped startup with only used vectors is written for 13A, bigger processors can afford the standard one
+if [ "$MCU" = "attiny13a" ]; then
+	CFLAGS+=" -nostartfiles"
+	STARTUP=gcrt1.S
+fi
 
-avr-objcopy -O ihex -R .eeprom -R .fuse -R .lock -R .signature rukolamp.elf rukolamp.hex
-avr-size --mcu=$MCU --format=avr rukolamp.elf
-avr-objdump -h -S rukolamp.elf > rukolamp.lss
+avr-c++ -mmcu=$MCU $CFLAGS $STARTUP rukolamp.c -o $OUT.elf  > $OUT.lst
+
+avr-objcopy -O ihex -R .eeprom -R .fuse -R .lock -R .signature $OUT.elf $OUT.hex
+avr-size --mcu=$MCU --format=avr $OUT.elf
+avr-objdump -h -S $OUT.elf > $OUT.lss
+
+# per function bytes, worst-case path cycles and stack against the flash / sram of the processor and baseline $OUT.budget
+./budget.py --flash $FLASH --ram $RAM --baseline $OUT.budget $OUT.elf
@@ -0,0 +1,111 @@
+#ifndef FUEL_GAUGE_H
+#define FUEL_GAUGE_H
+/*
+ * Fuel gauge - estimate of remaining battery charge.
+ *
+ * Instantaneous voltage under load (or shortly after turbo) tells very little about remaining charge,
+ * so consumed charge is integrated from real output (actual_pwm_output - power_reduction)
+ * once per round of main loop (approx. 2sec, the same timing as undervoltage protection uses).
+ * Estimate survives fast presses in .noinit sram and power cycles in its own wear leveled eeprom ring.
+ * At power on after long off the voltage (read before led is turned on) is used to correct the integrated
+ * value. Long off can be just about a second, and after turbo the cell needs minutes to recover, so the
+ * voltage may still be low - it only raises the estimate when it is more than one bar above (freshly charged
+ * or swapped battery), lowering is left to a gap bigger than any load sag.
+ *
+ * Needs from includer: EEPSIZE, TICKS_PER_MINUTE, FUEL_FULL_RUNTIME_MINUTES, get_voltage(), battcheck() (BATTCHECK_8bars),
+ * eeprom_read() and register variables actual_mode, actual_pwm_output, power_reduction, ramping_trigger.
+ */
+
+#define FUEL_PER_BAR 28                        // one blink of battcheck
+#define FUEL_TRUST_BARS 1                      // integrated value is trusted within one bar from voltage (accuracy of both)
+#define FUEL_SAG_BARS 3                        // voltage after turbo may still be this many bars (0.3V) below rested one
+#define FUEL_FULL (9 * FUEL_PER_BAR)           // 252 - full battery, 0xff must not be stored (empty eeprom cell)
+#define FUEL_SAVE_STEP 4                       // write to eeprom after every 4/252 of charge (~63 writes per discharge)
+#define FUEL_EEPROM_START (EEPSIZE / 2)        // right after status ring
+#define FUEL_EEPROM_SIZE (EEPSIZE / 4)         // 16 cells on 13A, must be power of 2
+// how many pwm units (real pwm value summed every main loop round) make one step of fuel_level
+#define FUEL_STEP ((FUEL_FULL_RUNTIME_MINUTES * TICKS_PER_MINUTE * 255UL) / FUEL_FULL)
+
+uint8_t fuel_level __attribute__ ((section (".noinit")));   // 0 = empty .. FUEL_FULL
+uint8_t fuel_saved __attribute__ ((section (".noinit")));   // last value written to eeprom
+uint8_t fuel_eepos __attribute__ ((section (".noinit")));
+uint16_t fuel_acc __attribute__ ((section (".noinit")));    // consumed charge not yet subtracted from fuel_level
+
+void FuelGaugeSave() {
+	uint8_t sreg = SREG;
+	cli(); // WDT ISR can save status in the middle of our erase/write, dont let it
+	do {} while (EECR & (1 << EEPE)); // status or config write may still be running
+
+	// erase old value
+	EEARL = fuel_eepos;
+	EECR = (1 << EEMPE) | (0 << EEPM1) | (1 << EEPM0);
+	EECR |= (1 << EEPE);
+	do {} while (EECR & (1 << EEPE));
+
+	fuel_eepos = FUEL_EEPROM_START + ((fuel_eepos + 1) & (FUEL_EEPROM_SIZE - 1));  // wear leveling, use next cell
+
+	EEARL = fuel_eepos;
+	EEDR = fuel_level;
+	EECR = (1 << EEMPE) | (1 << EEPM1) | (0 << EEPM0);
+	EECR |= (1 << EEPE);
+	do {} while (EECR & (1 << EEPE)); // SaveStatusAndConfig does not wait before its erase, so finish here
+
+	fuel_saved = fuel_level;
+	SREG = sreg;
+}
+
+inline void FuelGaugeRestore() {
+	uint8_t eep;
+
+	fuel_level = 0; // nothing saved yet, voltage correction raises it
+	fuel_eepos = FUEL_EEPROM_START;
+	fuel_acc = 0;
+	for(uint8_t i = FUEL_EEPROM_START; i < FUEL_EEPROM_START + FUEL_EEPROM_SIZE; i++) {
+		eep = eeprom_read(i);
+		if (eep != 0xff) {
+			fuel_eepos = i;
+			fuel_level = eep;
+			break;
+		}
+	}
+	fuel_saved = fuel_level;
+}
+
+// 0 .. 9 blinks, the same scale as voltage based battcheck()
+inline uint8_t FuelGaugeBars() {
+	return fuel_level / FUEL_PER_BAR;
+}
+
+// Called only after long off (led off for at least a second), voltage may still be depressed by previous load
+inline void FuelGaugeCorrectByVoltage() {
+	get_voltage(); // first conversion after ADC_on() (enable + bandgap reference selection) may be inaccurate, throw it away
+	uint8_t bars = battcheck();
+
+	// compared in bars as battcheck blinks them, position of fuel_level within its bar does not matter
+	if ((bars > FuelGaugeBars() + FUEL_TRUST_BARS) || (bars + FUEL_SAG_BARS < FuelGaugeBars())) {
+		fuel_level = bars * FUEL_PER_BAR;
+		FuelGaugeSave();
+	}
+}
+
+// Called once per main loop round
+inline void FuelGaugeTick() {
+	// blinkies have almost zero duty (actual_pwm_output is faked there for LVP)
+	// and running ramping rounds are much shorter than 2sec, so count only steady output.
+	// ramping_trigger is checked only in ramping mode - after long off it is not initialised
+	if ((actual_mode != MODE_BLINKY) && !((actual_mode == MODE_RAMPING) && ramping_trigger)) {
+		fuel_acc += (uint8_t)(actual_pwm_output - power_reduction);
+		while (fuel_acc >= FUEL_STEP) {
+			fuel_acc -= FUEL_STEP;
+			if (fuel_level) fuel_level--;
+		}
+		if ((uint8_t)(fuel_saved - fuel_level) >= FUEL_SAVE_STEP) FuelGaugeSave();
+	}
+}
+
+// Undervoltage under load means we are almost empty, whatever the integration says
+inline void FuelGaugeLowVoltage() {
+	if (fuel_level > FUEL_PER_BAR) fuel_level = FUEL_PER_BAR;
+}
+
+#endif  // FUEL_GAUGE_H
@@ -11,16 +11,13 @@
 #include <avr/wdt.h>
 #include <util/delay_basic.h>
 
-//ATtiny13A definitions
-#define F_CPU 4800000UL
-#define EEPSIZE 64
-#define V_REF REFS0
-#define BOGOMIPS 950
+#include "targets.h" // clock, eeprom size, adc reference... of the processor
+
+//driver board definitions
 #define PWM_PIN     PB1
 #define VOLTAGE_PIN PB2
 #define ADC_CHANNEL 0x01    // MUX 01 corresponds with PB2
 #define ADC_DIDR    ADC1D   // Digital input disable bit corresponding with PB2
-#define ADC_PRSCL   0x05    // clk/32 (makes it 150kHz)
 #define PWM_LVL     OCR0B   // OCR0B is the output compare register for PB1
 
 #define FAST 0x23           // fast PWM channel 1 only
@@ -32,8 +29,6 @@
 // 6 .. 8 - so far not used
 #define DEFAULTS_CONFIG 0b00000000  // NORMAL mode, 6 levels (level group 0), without memory
 #define CONFIG_EEPROM_ADDRESS EEPSIZE - 1
-#define EEPE EEWE //found out, that in avr-libc 1.8 there are different names of these two bits than in datasheet
-#define EEMPE EEMWE
 
 // state memory byte bits usage:
 // used when memory is ON, to save actual state of flashlight - which mode and which level is set
@@ -63,6 +58,9 @@
 #define ADC_LOW    ADC_30  // When do we start ramping down
 #include "tk-voltage.h"
 
+//#define USE_FUEL_GAUGE	 // battcheck shows integrated charge estimate instead of voltage (does not fit into 13A flash with the rest, targets.h enables it on bigger processors)
+#define FUEL_FULL_RUNTIME_MINUTES 60 // how long full battery lasts on 100%, calibrate for your cell and led
+
 #define PWM_RAMP_SIZE  8
 #define PWM_RAMP_VALUES   5, 26, 64, 85, 128, 169, 192, 255  // 1, 10, 25, 33, 50, 66, 75, 100%
 
@@ -88,6 +86,22 @@
 #define CONFIG_BLINK_BRIGHTNESS	15 // output to use for blinks on battery check (and other modes) = 10%
 #define CONFIG_BLINK_SPEED	30 // *5ms=150ms per normal-speed blink
 
+// Graded off-time: instead of one "fast press" answer, count how many bits of seeded sram region decayed while off.
+// Short click = next level, medium click (approx. 0.5-1.5s off) = previous level,
+// short + medium = jump to turbo (highest level), medium + medium = next mode
+//#define USE_OFFTIME_BANDS	// does not fit into 13A flash with the rest, targets.h enables it on bigger processors
+#define OFFTIME_CANARY_BYTES 8	// 64 bits of sram seeded with pattern on every boot
+#define OFFTIME_PATTERN 0b01010101
+#define OFFTIME_SHORT_MAX_BITS 0	// nothing decayed yet
+#define OFFTIME_MEDIUM_MAX_BITS 12	// fully decayed sram has approx. half of the bits flipped, so more than this is long off
+#define OFFTIME_SHORT 0
+#define OFFTIME_MEDIUM 1
+#define OFFTIME_LONG 2
+#define STATE_COPIES 7	// copies of state and click band in sram for medium click (odd for majority), each stored with its complement
+#define COPY_STATE 0	// offset of mode and level in state_copy
+#define COPY_BAND 2	// offset of band of previous click in state_copy
+#define LEVEL_ID_LAST 0xff	// resolved to last level of actual group after levels are counted
+
 #define TURBO_MINUTES 1 // when turbo timer is enabled, how long before stepping down
 #define TICKS_PER_MINUTE 30 // used for Turbo Timer timing
 #define TURBO_LOWER 128  // the PWM level to use when stepping down
@@ -103,6 +117,10 @@
 
 #define NUM_FP_BYTES 3
 uint8_t fast_presses[NUM_FP_BYTES] __attribute__ ((section (".noinit")));
+#ifdef USE_OFFTIME_BANDS
+uint8_t offtime_canary[OFFTIME_CANARY_BYTES] __attribute__ ((section (".noinit")));
+uint8_t state_copy[4 * STATE_COPIES] __attribute__ ((section (".noinit")));	// state, ~state, band, ~band
+#endif
 
 // Blinky modes, first and last entry must correspond with FIRST_BLINKY and LAST_BLINKY
 //const uint8_t blinky_mode_list[] PROGMEM = { BLINKY_BATT_CHECK, BLINKY_STROBE, BLINKY_BEACON };
@@ -112,7 +130,11 @@ const uint8_t pwm_ramp_values[] PROGMEM = { PWM_RAMP_VALUES };
 
 const uint8_t pwm_fine_ramp_values[] PROGMEM = { FINE_RAMP_VALUES };
 
-#define NUM_LEVEL_GROUPS 8 // Can define up to 16 groups, theoretically the group can have up to 16 level entries
+#ifdef EXTRA_LEVEL_GROUPS
+#define NUM_LEVEL_GROUPS 12 // Can define up to 16 groups, theoretically the group can have up to 16 level entries
+#else
+#define NUM_LEVEL_GROUPS 8
+#endif
 const uint8_t level_groups[] PROGMEM = {
 	1, 2, 3, 4, 6, 8, 0,
 	3, 5, 7, 8, 0,
@@ -122,6 +144,12 @@ const uint8_t level_groups[] PROGMEM = {
 	5, 0,
 	1, 2, 3, 0,
 	3, 7, 0,
+#ifdef EXTRA_LEVEL_GROUPS // bigger processors have flash to spare for these
+	1, 4, 8, 0,
+	2, 5, 8, 0,
+	1, 3, 5, 7, 0,
+	8, 0,
+#endif
 };
 // has to be the same lenght as the longest level group (in our case 6)
 #define LONGEST_LEVEL_GROUP 6 // dont forget to update if editing groups
@@ -168,6 +196,63 @@ void ResetFastPresses() {
 	for(i = 0; i < NUM_FP_BYTES; i++) { fast_presses[i] = 0; }
 }
 
+#ifdef USE_OFFTIME_BANDS
+inline uint8_t MeasureOffTime() {
+	uint8_t i, bits, decayed = 0;
+	for(i = 0; i < OFFTIME_CANARY_BYTES; i++) {
+		bits = offtime_canary[i] ^ OFFTIME_PATTERN;
+		offtime_canary[i] = OFFTIME_PATTERN; // seed again for next off
+		for(; bits; bits >>= 1) { decayed += bits & 1; }
+	}
+	if (decayed <= OFFTIME_SHORT_MAX_BITS) return OFFTIME_SHORT;
+	if (decayed <= OFFTIME_MEDIUM_MAX_BITS) return OFFTIME_MEDIUM;
+	return OFFTIME_LONG;
+}
+
+// Eeprom has the state saved after 2sec of light only, so medium click after quick
+// clicks would go back from older level. Keep actual one in sram with redundancy,
+// the same for band of the click (in eeprom it would be one cell written on every click).
+void SaveCopy(uint8_t offset, uint8_t value) {
+	for(uint8_t i = offset; i < 4 * STATE_COPIES; i += 4) {
+		state_copy[i] = value;
+		state_copy[i + 1] = ~value;
+	}
+}
+
+inline void SaveStateCopy() {
+	SaveCopy(COPY_STATE, actual_mode | (actual_level_id << 2));
+}
+
+// Bitwise majority of values (offset COPY_xxx) or complements (offset COPY_xxx + 1)
+uint8_t StateCopyMajority(uint8_t offset) {
+	uint8_t result = 0;
+	for(uint8_t mask = 1; mask; mask <<= 1) {
+		uint8_t votes = 0;
+		for(uint8_t i = offset; i < 4 * STATE_COPIES; i += 4) {
+			if (state_copy[i] & mask) votes++;
+		}
+		if (votes > STATE_COPIES / 2) result |= mask;
+	}
+	return result;
+}
+
+// Used only when majority of values matches majority of complements, otherwise state from eeprom stays
+inline void RestoreStateCopy() {
+	uint8_t value = StateCopyMajority(COPY_STATE);
+	if (value == (uint8_t)~StateCopyMajority(COPY_STATE + 1)) {
+		actual_mode = value & 0b00000011;
+		actual_level_id = value >> 2;
+	}
+}
+
+// OFFTIME_LONG stands also for "no click sequence running" (set by WDT after 1sec of light) and for unreadable copy
+inline uint8_t RestoreBandCopy() {
+	uint8_t band = StateCopyMajority(COPY_BAND);
+	if (band == (uint8_t)~StateCopyMajority(COPY_BAND + 1)) return band;
+	return OFFTIME_LONG;
+}
+#endif
+
 uint8_t __attribute__((noinline)) eeprom_read (uint8_t address)
 {
 	EEARL = address;
@@ -212,10 +297,19 @@ void SaveStatusAndConfig() {  // save the current mode index (with wear leveling
 	}
 }
 
+#ifdef USE_FUEL_GAUGE
+#include "fuel-gauge.h"
+#endif
+
 //EMPTY_INTERRUPT(BADISR_vect); //just for case - eliminated by custom startup files
 
+#ifdef WDT_ISR_NAKED
 ISR(WDT_vect, ISR_NAKED)
+#else
+ISR(WDT_vect) // register list below is valid only for 13A build, others have flash for ordinary ISR
+#endif
 {
+#ifdef WDT_ISR_NAKED
 	//This is not clean, but works.
 	//By using ISR_NAKED we save approx. 50bytes of flash, because without that
 	//compiler is saving all between R15..R30 which is crazy.
@@ -224,6 +318,7 @@ ISR(WDT_vect, ISR_NAKED)
 	asm("push r18\n\t"
 	"push r24\n\t"
 	"push r25\n\t"::);
+#endif
 
 	ResetFastPresses();
 
@@ -234,14 +329,19 @@ ISR(WDT_vect, ISR_NAKED)
 		SaveStatusAndConfig();
 	}
 	else {
+#ifdef USE_OFFTIME_BANDS
+		SaveCopy(COPY_BAND, OFFTIME_LONG); // click sequence is over, the same as fast presses
+#endif
 		sei(); //this was 1st passthrough (1 second), we need also 2nd so activate interrupts for one more time
 	}
 
 	watchdog_counter++;
+#ifdef WDT_ISR_NAKED
 	asm("pop r25\n\t"
 	"pop r24\n\t"
 	"pop r18\n\t"::);
 	__asm__("ret\n\t"); //trick how to leave interrupts turned off after returning from function when we want it
+#endif
 }
 
 inline void FirstBootState() {
@@ -364,10 +464,24 @@ inline void NextMode() {
 	// Since we start on each mode always on level_id 0, we dont need to know real number of levels here
 }
 
+#ifdef USE_OFFTIME_BANDS
+inline void PrevLevel() {
+	if (actual_level_id == 0) {
+		actual_level_id = LEVEL_ID_LAST; // wrap to the end, the same way as NextLevel wraps to first
+	}
+	else {
+		actual_level_id--;
+	}
+}
+#endif
+
 // =========================================================================
 
 int __attribute__((noreturn,OS_main)) main (void)
 {
+#ifdef CLEAR_EEARH
+	EEARH = 0; // all eeprom accesses below write EEARL only
+#endif
 
 	DDRB |= (1 << PWM_PIN);	 // Set PWM pin to output, enable main channel
 	TCCR0A = FAST; // Set timer to do PWM for correct output pin and set prescaler timing
@@ -376,8 +490,38 @@ int __attribute__((noreturn,OS_main)) main (void)
 	ADC_on();
 
 	// check button press time, unless we're in group selection mode
+#ifdef USE_OFFTIME_BANDS
+	uint8_t offtime = MeasureOffTime();
+	if ((offtime == OFFTIME_SHORT) && !WeDidAFastPress()) offtime = OFFTIME_LONG; // handled as long press below
+	uint8_t prev_offtime = RestoreBandCopy();
+	SaveCopy(COPY_BAND, offtime);
+	if (offtime == OFFTIME_MEDIUM) {
+		// sram and registers could be partly decayed, take config from eeprom and state from sram copy if still readable
+		RestoreStatusAndConfig();
+		RestoreStateCopy();
+#ifdef USE_FUEL_GAUGE
+		FuelGaugeRestore();
+#endif
+		ramping_trigger = 0;
+
+		if (prev_offtime == OFFTIME_MEDIUM) {
+			NextMode(); // medium + medium
+		}
+		else if (prev_offtime == OFFTIME_SHORT) {
+			actual_level_id = LEVEL_ID_LAST; // short + medium, highest level of group is turbo
+		}
+		else {
+			PrevLevel();
+		}
+
+		ResetFastPresses(); // count short presses from zero after medium one
+	}
+	else if (offtime == OFFTIME_SHORT) {
+		IncrementFastPresses();
+#else
 	if ( WeDidAFastPress() ) { // sram hasn't decayed yet, must have been a short press
 		IncrementFastPresses();
+#endif
 
 		// triple-tap from a solid mode
 		if(fast_presses[0] == 5) {
@@ -408,13 +552,25 @@ int __attribute__((noreturn,OS_main)) main (void)
 
 		// Does not necessarily have to be used now because we have not implemented saving to memory at all so all is defaultly on 0 anyway
 		RestoreStatusAndConfig(); // Read config values and saved state / or use defaults
+#ifdef USE_FUEL_GAUGE
+		FuelGaugeRestore();
+		FuelGaugeCorrectByVoltage(); // light is still off, but battery may not have recovered from turbo yet
+#endif
 	}
 
 	uint8_t num_available_levels = CountNumLevelsForGroupAndMode(actual_mode);
+#ifdef USE_OFFTIME_BANDS
+	if (actual_level_id == LEVEL_ID_LAST) {
+		actual_level_id = num_available_levels - 1;
+	}
+#endif
 	// if we hit the end of list, go to first
 	if (actual_level_id >= num_available_levels) {
 		actual_level_id = 0;
 	}
+#ifdef USE_OFFTIME_BANDS
+	SaveStateCopy();
+#endif
 
 	//Watchdog start moved here (from start of main() so we dont have to bother with its non wanted timeout during config mode)
 	//start watchdog to measure one second from start to be able to clear fast presses independetly from main loop where sleeps and other stuff happens
@@ -451,7 +607,11 @@ int __attribute__((noreturn,OS_main)) main (void)
 				_delay_5ms(200);
 			}
 			else if (actual_level_id == BLINKY_BATT_CHECK) {
+#ifdef USE_FUEL_GAUGE
+				blink(FuelGaugeBars(), CONFIG_BLINK_SPEED);
+#else
 				blink(battcheck(), CONFIG_BLINK_SPEED);
+#endif
 				actual_pwm_output = CONFIG_BLINK_BRIGHTNESS; //little hack for un-confuse low voltage protection mechanism
 				_delay_5ms(200);
 				_delay_5ms(200);
@@ -462,6 +622,9 @@ int __attribute__((noreturn,OS_main)) main (void)
 				actual_level_id += ramping_trigger;
 				if (actual_level_id == (FINE_RAMP_SIZE - 1)) ramping_trigger = RAMPING_TRIGGER_VALUE_DOWN; //handles top end
 				if (actual_level_id == 0) { ramping_trigger = RAMPING_TRIGGER_VALUE_UP;} //handles low end
+#ifdef USE_OFFTIME_BANDS
+				SaveStateCopy();
+#endif
 			}
 			SetOutputPwm(pgm_read_byte(&pwm_fine_ramp_values[actual_level_id]));
 			if (ramping_trigger != 0) {
@@ -506,6 +669,10 @@ int __attribute__((noreturn,OS_main)) main (void)
 
 		// INFO: Need to keep all modes branch ifs (beacon, etc) to run approx 2sec, to properly work undervoltage reduction cycle speed
 
+#ifdef USE_FUEL_GAUGE
+		FuelGaugeTick();
+#endif
+
 		//ResetFastPresses(); // Probably already cleared by interrupt from watchdog, i think I will remove it from this location
 
 		// Battery undervoltage protection
@@ -529,6 +696,9 @@ int __attribute__((noreturn,OS_main)) main (void)
 				else { decrease_step = 1; }
 
 				power_reduction += decrease_step;
+#ifdef USE_FUEL_GAUGE
+				FuelGaugeLowVoltage();
+#endif
 
 				if (power_reduction > actual_pwm_output) { // Already at the lowest mode
 					PWM_LVL = 0; //SetOutputPwm(0); // Turn off the light
@@ -0,0 +1,7 @@
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+/*
+ * Mock of avr-libc <avr/eeprom.h>, firmware accesses EEPROM registers directly
+ */
+
+#endif  // SIM_AVR_EEPROM_H
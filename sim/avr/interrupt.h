@@ -0,0 +1,16 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+/*
+ * Mock of avr-libc <avr/interrupt.h>
+ */
+
+#include "../sim.h"
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR_NAKED
+#define ISR(vector, ...) extern "C" void vector(void); extern "C" void vector(void)
+#define EMPTY_INTERRUPT(vector) extern "C" void vector(void) {}
+
+#endif  // SIM_AVR_INTERRUPT_H
@@ -0,0 +1,106 @@
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+/*
+ * Mock of avr-libc <avr/io.h> for ATtiny13A and ATtiny25/45/85, used by simulate.sh
+ */
+
+#include "../sim.h" // selects the processor
+
+// Firmware pins its globals into registers and uses inline asm in the naked WDT ISR.
+// On host the register variables become plain globals in the same section as .noinit ones
+// (registers lose content during power off the same way as sram does), the asm is dropped
+// and all .noinit data is collected in section sim_noinit, so simulation can decay it.
+#define register
+#define asm(...) __attribute__ ((section (".noinit")))
+#define __asm__(...)
+#define section(name) section("sim_noinit")
+
+#define _SFR_IO8(addr) SimReg8(addr)
+
+#define ADCH   _SFR_IO8(SIM_ADCH)
+#define ADCSRA _SFR_IO8(SIM_ADCSRA)
+#define ADMUX  _SFR_IO8(SIM_ADMUX)
+#define DIDR0  _SFR_IO8(SIM_DIDR0)
+#define DDRB   _SFR_IO8(SIM_DDRB)
+#define PORTB  _SFR_IO8(SIM_PORTB)
+#define EECR   _SFR_IO8(SIM_EECR)
+#define EEDR   _SFR_IO8(SIM_EEDR)
+#define EEARL  _SFR_IO8(SIM_EEARL)
+#ifdef SIM_EEARH
+#define EEARH  _SFR_IO8(SIM_EEARH)
+#endif
+#define WDTCR  _SFR_IO8(SIM_WDTCR)
+#define OCR0B  _SFR_IO8(SIM_OCR0B)
+#define TCCR0A _SFR_IO8(SIM_TCCR0A)
+#define TCCR0B _SFR_IO8(SIM_TCCR0B)
+#define MCUCR  _SFR_IO8(SIM_MCUCR)
+#define SREG   _SFR_IO8(SIM_SREG)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+
+// ADCSRA
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE  3
+#define ADIF  4
+#define ADATE 5
+#define ADSC  6
+#define ADEN  7
+
+// ADMUX
+#define MUX0  0
+#define MUX1  1
+#define ADLAR 5
+#define REFS0 6
+#ifndef __AVR_ATtiny13A__
+#define REFS2 4
+#define REFS1 7
+#endif
+
+// DIDR0
+#define AIN0D 0
+#define AIN1D 1
+#define ADC1D 2
+#define ADC3D 3
+#define ADC2D 4
+#define ADC0D 5
+
+// EECR (avr-libc 1.8 names for 13A, targets.h maps EEPE/EEMPE to them)
+#define EERE  0
+#ifdef __AVR_ATtiny13A__
+#define EEWE  1
+#define EEMWE 2
+#else
+#define EEPE  1
+#define EEMPE 2
+#endif
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+
+// WDTCR
+#define WDP0  0
+#define WDP1  1
+#define WDP2  2
+#define WDE   3
+#define WDCE  4
+#define WDP3  5
+#ifdef __AVR_ATtiny13A__
+#define WDTIE 6
+#define WDTIF 7
+#else
+#define WDIE  6
+#define WDIF  7
+#endif
+
+// MCUCR
+#define SM0 3
+#define SM1 4
+#define SE  5
+
+#endif  // SIM_AVR_IO_H
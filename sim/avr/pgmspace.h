@@ -0,0 +1,12 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+/*
+ * Mock of avr-libc <avr/pgmspace.h>, flash is ordinary memory on host
+ */
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+#endif  // SIM_AVR_PGMSPACE_H
@@ -0,0 +1,16 @@
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+/*
+ * Mock of avr-libc <avr/sleep.h>
+ */
+
+#include "io.h"
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_ADC      (1 << SM0)
+#define SLEEP_MODE_PWR_DOWN (1 << SM1)
+
+#define set_sleep_mode(mode) (MCUCR = (MCUCR & ~((1 << SM0) | (1 << SM1))) | (mode))
+#define sleep_mode() sim_sleep()
+
+#endif  // SIM_AVR_SLEEP_H
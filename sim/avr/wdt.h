@@ -0,0 +1,20 @@
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+/*
+ * Mock of avr-libc <avr/wdt.h>
+ */
+
+#include "../sim.h"
+
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+
+#define wdt_reset() sim_wdt_reset()
+
+#endif  // SIM_AVR_WDT_H
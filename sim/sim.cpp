@@ -0,0 +1,469 @@
+/*
+ * Host simulation of rukolamp firmware - runs rukolamp.c against mocked AVR headers,
+ * drives it by scenario file and records its I/O activity into VCD file (viewable in GTKWave).
+ *
+ * usage: rukolamp-sim <scenario> <output.vcd> [output.trace]
+ *
+ * Optional trace is a timeline of light output (one line per change: time in ms, pwm value, F/P for
+ * fast/phase-correct pwm), which is compared with golden traces by test.sh.
+ *
+ * Scenario is a text file with one command per line, # starts a comment:
+ *   battery <t_ms> <volts>        battery voltage keyframe at absolute time, linear between keyframes
+ *   sag <volts>                   battery voltage drop at 100% output (internal resistance)
+ *   recovery <volts> <ms>         slow voltage drop at 100% output (polarization), builds up under load
+ *                                 and recovers after it with given time constant
+ *   decay <min_ms> <max_ms>       sram retention spread - each bit keeps its value for random time in this range
+ *   powerup <byte>                power-up value of sram and registers (default is random for each bit)
+ *   on <ms>                       power on for given time
+ *   off <ms>                      power off for given time
+ *   clicks <n> <off_ms> <on_ms>   n times: off, on
+ * Following on (or off) periods join into one, so "clicks" can be prolonged by "on".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "sim.h"
+#include "../targets.h" // F_CPU of simulated processor and kind of its WDT_vect
+
+#define NEVER UINT64_MAX
+
+extern "C" void WDT_vect(void);
+int firmware_main(void);
+
+// .noinit data and register variables of firmware (see avr/io.h)
+extern uint8_t __start_sim_noinit[], __stop_sim_noinit[];
+
+struct PowerOff {};  // thrown out of firmware when power goes down
+
+struct Step {
+	bool on;
+	uint64_t duration;  // cycles
+};
+
+struct Keyframe {
+	uint64_t at;  // cycles
+	double volts;
+};
+
+static std::vector<Step> steps;
+static std::vector<Keyframe> battery;
+static double sag_volts = 0.0;
+static double recovery_volts = 0.0, recovery_ms = 0.0;
+static double decay_min_ms = 300.0, decay_max_ms = 1500.0;
+static int powerup_value = -1;
+
+static uint64_t now = 0;
+static uint64_t power_off_at = NEVER;
+static uint8_t io[64];
+static uint8_t eeprom[SIM_EEPSIZE];
+static uint8_t in_isr = 0;
+static uint32_t isr_count = 0;
+
+static uint64_t adc_done_at = NEVER;
+static uint8_t adc_first = 1;
+static uint64_t ee_done_at = NEVER;
+static uint64_t wdt_deadline = NEVER;
+static uint8_t wdt_pending = 0;
+
+static FILE *vcd;
+static uint64_t vcd_time = NEVER;
+static FILE *trace;
+static uint8_t powered = 0;
+static double polarization = 0.0;  // actual slow voltage drop
+static double polarization_load = 0.0;  // output since polarization_at, 0..1
+static uint64_t polarization_at = 0;
+
+static uint64_t ms_to_cycles(double ms) { return (uint64_t)(ms * F_CPU / 1000.0); }
+
+// =========================================================================
+// VCD output
+
+enum {
+	SIG_POWER, SIG_OCR0B, SIG_TCCR0A, SIG_VBAT, SIG_ADC_CONV, SIG_ADC,
+	SIG_EE_OP, SIG_EE_ADDR, SIG_EE_DATA, SIG_WDT_ISR, SIG_SLEEP, NUM_SIGNALS
+};
+
+static const struct { const char *name; int width; } signals[NUM_SIGNALS] = {
+	{ "power", 1 }, { "ocr0b", 8 }, { "tccr0a", 8 }, { "vbat", 0 }, { "adc_conv", 1 }, { "adc", 8 },
+	{ "ee_op", 2 }, { "ee_addr", SIM_EEPSIZE > 256 ? 9 : 8 }, { "ee_data", 8 }, { "wdt_isr", 1 }, { "sleep", 1 },
+};
+
+static void vcd_header() {
+	fprintf(vcd, "$comment rukolamp host simulation, F_CPU %lu Hz $end\n", (unsigned long)F_CPU);
+	fprintf(vcd, "$comment ee_op: 1 = erase, 2 = write, 3 = erase and write $end\n");
+	fprintf(vcd, "$timescale 1ns $end\n$scope module %s $end\n", SIM_MCU);
+	for (int i = 0; i < NUM_SIGNALS; i++) {
+		if (signals[i].width == 0) fprintf(vcd, "$var real 64 %c %s $end\n", '!' + i, signals[i].name);
+		else fprintf(vcd, "$var wire %d %c %s $end\n", signals[i].width, '!' + i, signals[i].name);
+	}
+	fprintf(vcd, "$upscope $end\n$enddefinitions $end\n");
+}
+
+static void vcd_stamp() {
+	uint64_t ns = now * 1000000000ULL / F_CPU;
+	if (ns != vcd_time) {
+		fprintf(vcd, "#%llu\n", (unsigned long long)ns);
+		vcd_time = ns;
+	}
+}
+
+static void vcd_value(int sig, unsigned value) {
+	vcd_stamp();
+	if (signals[sig].width == 1) {
+		fprintf(vcd, "%u%c\n", value & 1, '!' + sig);
+	}
+	else {
+		fputc('b', vcd);
+		for (int bit = signals[sig].width - 1; bit >= 0; bit--) fputc((value >> bit) & 1 ? '1' : '0', vcd);
+		fprintf(vcd, " %c\n", '!' + sig);
+	}
+}
+
+static void vcd_real(int sig, double value) {
+	vcd_stamp();
+	fprintf(vcd, "r%.3f %c\n", value, '!' + sig);
+}
+
+// =========================================================================
+// trace of light output
+
+static void trace_output() {
+	static int last = -1;
+	if (!trace) return;
+	uint8_t pwm = powered ? io[SIM_OCR0B] : 0;
+	char kind = (io[SIM_TCCR0A] & 0x02) ? 'F' : 'P';
+	int current = (pwm << 8) | kind;
+	if (current != last) {
+		fprintf(trace, "%.3f %u %c\n", now * 1000.0 / F_CPU, pwm, kind);
+		last = current;
+	}
+}
+
+// =========================================================================
+// peripherals
+
+// called on every change of load, moves slow voltage drop towards its value under load since last call
+static void polarization_update() {
+	if (recovery_ms > 0.0) {
+		double target = recovery_volts * polarization_load;
+		polarization = target + (polarization - target) * exp(-(double)(now - polarization_at) * 1000.0 / F_CPU / recovery_ms);
+	}
+	polarization_at = now;
+	polarization_load = powered ? io[SIM_OCR0B] / 255.0 : 0.0;
+}
+
+static double battery_volts() {
+	double volts = battery.empty() ? 4.2 : battery.back().volts;
+	for (size_t i = 0; i < battery.size(); i++) {
+		if (now < battery[i].at) {
+			if (i == 0) { volts = battery[0].volts; break; }
+			const Keyframe &a = battery[i - 1], &b = battery[i];
+			volts = a.volts + (b.volts - a.volts) * (double)(now - a.at) / (double)(b.at - a.at);
+			break;
+		}
+	}
+	// only full-on pwm output loads the battery, power down sleep does not
+	polarization_update();
+	return volts - sag_volts * io[SIM_OCR0B] / 255.0 - polarization;
+}
+
+static void adc_start() {
+	// first conversion after enabling takes 25 ADC clocks, others 13
+	uint8_t prescaler = 1 << (io[SIM_ADCSRA] & 0x07);
+	if (prescaler == 1) prescaler = 2;
+	adc_done_at = now + (adc_first ? 25 : 13) * prescaler;
+	adc_first = 0;
+	vcd_value(SIG_ADC_CONV, 1);
+}
+
+static void adc_finish() {
+	// voltage divider 30k:10k against 1.1V internal reference, left adjusted result
+	double volts = battery_volts();
+	double result = volts / 4.0 / 1.1 * 256.0;
+	io[SIM_ADCH] = result > 255.0 ? 255 : (uint8_t)result;
+	io[SIM_ADCSRA] = (io[SIM_ADCSRA] & ~(1 << 6)) | (1 << 4);  // ADSC done, ADIF set
+	adc_done_at = NEVER;
+	vcd_real(SIG_VBAT, volts);
+	vcd_value(SIG_ADC, io[SIM_ADCH]);
+	vcd_value(SIG_ADC_CONV, 0);
+}
+
+static uint16_t ee_address() {
+#ifdef SIM_EEARH
+	return ((io[SIM_EEARH] << 8) | io[SIM_EEARL]) & (SIM_EEPSIZE - 1);
+#else
+	return io[SIM_EEARL] & (SIM_EEPSIZE - 1);
+#endif
+}
+
+static void ee_start(uint8_t mode) {
+	uint16_t addr = ee_address();
+	// datasheet: erase and write 3.4ms, erase only or write only 1.8ms
+	uint8_t op = (mode == 0) ? 3 : (mode == 1) ? 1 : 2;
+	if (op & 1) eeprom[addr] = 0xff;
+	if (op & 2) eeprom[addr] &= io[SIM_EEDR];
+	ee_done_at = now + ms_to_cycles(op == 3 ? 3.4 : 1.8);
+	vcd_value(SIG_EE_ADDR, addr);
+	vcd_value(SIG_EE_DATA, eeprom[addr]);
+	vcd_value(SIG_EE_OP, op);
+}
+
+static void ee_finish() {
+	io[SIM_EECR] &= ~(1 << 1);  // EEPE
+	ee_done_at = NEVER;
+	vcd_value(SIG_EE_OP, 0);
+}
+
+static uint64_t wdt_period() {
+	// 128kHz watchdog oscillator, 2048 << WDP cycles
+	uint8_t wdp = (io[SIM_WDTCR] & 0x07) | ((io[SIM_WDTCR] >> 2) & 0x08);
+	return (uint64_t)(2048UL << wdp) * F_CPU / 128000UL;
+}
+
+static void run_isr() {
+	wdt_pending = 0;
+	isr_count++;
+	in_isr = 1;
+	io[SIM_SREG] &= ~0x80;  // entering interrupt clears I
+	vcd_value(SIG_WDT_ISR, 1);
+	WDT_vect();
+	vcd_value(SIG_WDT_ISR, 0);
+	in_isr = 0;
+#ifdef WDT_ISR_NAKED
+	// firmware leaves ISR by plain ret, so I stays as ISR left it
+#else
+	io[SIM_SREG] |= 0x80;  // reti
+#endif
+}
+
+static void advance(uint64_t cycles) {
+	uint64_t until = now + cycles;
+	for (;;) {
+		uint64_t next = until;
+		if (power_off_at < next) next = power_off_at;
+		if (adc_done_at < next) next = adc_done_at;
+		if (ee_done_at < next) next = ee_done_at;
+		if (wdt_deadline < next) next = wdt_deadline;
+		if (next > now) now = next;
+
+		if (now >= power_off_at) throw PowerOff();
+		if (now >= adc_done_at) adc_finish();
+		if (now >= ee_done_at) ee_finish();
+		if (now >= wdt_deadline) {
+			wdt_pending = 1;
+			wdt_deadline += wdt_period();
+		}
+		if (wdt_pending && (io[SIM_SREG] & 0x80) && !in_isr) run_isr();
+		if (now >= until) break;
+	}
+}
+
+// =========================================================================
+// interface for mocked avr-libc
+
+uint8_t sim_io_read(uint8_t addr) {
+	advance(1);
+	return io[addr];
+}
+
+void sim_io_write(uint8_t addr, uint8_t value) {
+	advance(1);
+	uint8_t old = io[addr];
+
+	switch (addr) {
+	case SIM_ADCSRA:
+		if (value & (1 << 4)) value &= ~(1 << 4); else value |= old & (1 << 4);  // ADIF cleared by writing one
+		if (!(value & (1 << 7))) { adc_first = 1; adc_done_at = NEVER; value &= ~(1 << 6); }
+		io[addr] = value;
+		if ((value & (1 << 7)) && (value & (1 << 6)) && adc_done_at == NEVER) adc_start();
+		return;
+	case SIM_EECR:
+		io[addr] = (value & ~(1 << 1)) | (old & (1 << 1));
+		if (value & (1 << 0)) {  // EERE
+			io[SIM_EEDR] = eeprom[ee_address()];
+			advance(4);
+		}
+		// EEPE starts operation only when EEMPE is set and nothing is running
+		if ((value & (1 << 1)) && (value & (1 << 2)) && ee_done_at == NEVER) {
+			io[addr] = (io[addr] | (1 << 1)) & ~(1 << 2);  // EEMPE is cleared by hardware
+			ee_start((value >> 4) & 0x03);
+		}
+		return;
+	case SIM_WDTCR:
+		io[addr] = value;
+		wdt_deadline = (value & (1 << 6)) ? now + wdt_period() : NEVER;
+		return;
+	case SIM_OCR0B:
+		io[addr] = value;
+		polarization_update();
+		vcd_value(SIG_OCR0B, value);
+		trace_output();
+		return;
+	case SIM_TCCR0A:
+		io[addr] = value;
+		vcd_value(SIG_TCCR0A, value);
+		trace_output();
+		return;
+	default:
+		io[addr] = value;
+	}
+}
+
+void sim_delay_cycles(uint32_t cycles) { advance(cycles); }
+
+void sim_sei() { io[SIM_SREG] |= 0x80; advance(1); }
+
+void sim_cli() { io[SIM_SREG] &= ~0x80; advance(1); }
+
+void sim_wdt_reset() {
+	if (io[SIM_WDTCR] & (1 << 6)) wdt_deadline = now + wdt_period();
+	advance(1);
+}
+
+void sim_sleep() {
+	// power down - only watchdog interrupt (or power off) wakes us up
+	uint32_t isr = isr_count;
+	vcd_value(SIG_SLEEP, 1);
+	while (isr == isr_count) advance(F_CPU / 1000);
+	vcd_value(SIG_SLEEP, 0);
+}
+
+// =========================================================================
+// power cycles
+
+static uint32_t hash(uint32_t x) {
+	x ^= x >> 16; x *= 0x7feb352dU;
+	x ^= x >> 15; x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+// Every bit of sram has its power-up value and retention time, both fixed for given chip
+static void decay_sram(double off_ms) {
+	uint32_t size = __stop_sim_noinit - __start_sim_noinit;
+	for (uint32_t i = 0; i < size * 8; i++) {
+		uint32_t h = hash(i + 1);
+		double retention = decay_min_ms + (decay_max_ms - decay_min_ms) * (h & 0xffff) / 65535.0;
+		if (off_ms > retention) {
+			uint8_t mask = 1 << (i & 7);
+			uint8_t value = (powerup_value < 0) ? (h & 0x10000) != 0 : (powerup_value & mask) != 0;
+			if (value) __start_sim_noinit[i / 8] |= mask; else __start_sim_noinit[i / 8] &= ~mask;
+		}
+	}
+}
+
+static void power_on(uint64_t duration) {
+	memset(io, 0, sizeof(io));
+#ifdef SIM_EEARH
+	static uint32_t power_ons = 0;
+	io[SIM_EEARH] = hash(++power_ons) & 1;  // EEAR is undefined after reset, EEAR8 is the only bit of EEARH
+#endif
+	adc_done_at = ee_done_at = wdt_deadline = NEVER;
+	adc_first = 1;
+	wdt_pending = 0;
+	in_isr = 0;
+	power_off_at = now + duration;
+	powered = 1;
+	polarization_update();
+	vcd_value(SIG_POWER, 1);
+	vcd_value(SIG_OCR0B, 0);
+	vcd_value(SIG_TCCR0A, 0);
+	try {
+		firmware_main();
+	}
+	catch (PowerOff &) {
+	}
+	now = power_off_at;
+	power_off_at = NEVER;
+	// unfinished eeprom operation is left as it was started
+	ee_done_at = NEVER;
+	vcd_value(SIG_EE_OP, 0);
+	vcd_value(SIG_ADC_CONV, 0);
+	vcd_value(SIG_SLEEP, 0);
+	vcd_value(SIG_WDT_ISR, 0);
+	vcd_value(SIG_OCR0B, 0);
+	vcd_value(SIG_POWER, 0);
+	powered = 0;
+	polarization_update();
+	trace_output();
+}
+
+static void power_off(uint64_t duration) {
+	decay_sram(duration * 1000.0 / F_CPU);
+	now += duration;
+}
+
+// =========================================================================
+// scenario
+
+static void add_step(bool on, uint64_t duration) {
+	if (!steps.empty() && steps.back().on == on) steps.back().duration += duration;
+	else steps.push_back(Step{ on, duration });
+}
+
+static void load_scenario(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) { perror(path); exit(1); }
+
+	char line[256], cmd[32];
+	double a, b, c;
+	int lineno = 0;
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+		int n = sscanf(line, "%31s %lf %lf %lf", cmd, &a, &b, &c);
+		if (n <= 0) continue;
+
+		if (!strcmp(cmd, "battery") && n == 3) battery.push_back(Keyframe{ ms_to_cycles(a), b });
+		else if (!strcmp(cmd, "sag") && n == 2) sag_volts = a;
+		else if (!strcmp(cmd, "recovery") && n == 3) { recovery_volts = a; recovery_ms = b; }
+		else if (!strcmp(cmd, "decay") && n == 3) { decay_min_ms = a; decay_max_ms = b; }
+		else if (!strcmp(cmd, "powerup") && n == 2) powerup_value = (int)a;
+		else if (!strcmp(cmd, "on") && n == 2) add_step(true, ms_to_cycles(a));
+		else if (!strcmp(cmd, "off") && n == 2) add_step(false, ms_to_cycles(a));
+		else if (!strcmp(cmd, "clicks") && n == 4) {
+			for (int i = 0; i < (int)a; i++) {
+				add_step(false, ms_to_cycles(b));
+				add_step(true, ms_to_cycles(c));
+			}
+		}
+		else {
+			fprintf(stderr, "%s:%d: bad command\n", path, lineno);
+			exit(1);
+		}
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <scenario> <output.vcd> [output.trace]\n", argv[0]);
+		return 1;
+	}
+	load_scenario(argv[1]);
+	vcd = fopen(argv[2], "w");
+	if (!vcd) { perror(argv[2]); return 1; }
+	if (argc == 4) {
+		trace = fopen(argv[3], "w");
+		if (!trace) { perror(argv[3]); return 1; }
+	}
+
+	// fresh chip - erased eeprom, sram in its power-up state
+	memset(eeprom, 0xff, sizeof(eeprom));
+	decay_sram(1e9);
+
+	vcd_header();
+	vcd_value(SIG_POWER, 0);
+	for (size_t i = 0; i < steps.size(); i++) {
+		if (steps[i].on) power_on(steps[i].duration); else power_off(steps[i].duration);
+	}
+	vcd_stamp();
+	fclose(vcd);
+	if (trace) fclose(trace);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef SIM_H
+#define SIM_H
+/*
+ * Host simulation of ATtiny13A (or ATtiny25/45/85) for running rukolamp.c on linux.
+ *
+ * Only peripherals used by the firmware are modelled: timer0 pwm registers (just recorded),
+ * ADC (fed from scenario battery voltage), EEPROM (erase/write timing of the datasheet),
+ * watchdog interrupt, power-down sleep and sram decay while power is off.
+ * Time advances only in delay loops and register accesses, code itself is taken as free.
+ */
+
+#include <stdint.h>
+
+// Processor is selected the same way as avr-gcc -mmcu does it (simulate.sh MCU=...), default is ATtiny13A
+#if !defined(__AVR_ATtiny13A__) && !defined(__AVR_ATtiny25__) && !defined(__AVR_ATtiny45__) && !defined(__AVR_ATtiny85__)
+#define __AVR_ATtiny13A__
+#endif
+
+#if defined(__AVR_ATtiny13A__)
+// I/O addresses as in avr-libc iotn13a.h
+#define SIM_MCU "attiny13a"
+#define SIM_OCR0B  0x29
+#define SIM_TCCR0A 0x2F
+#define SIM_EEPSIZE 64
+#else
+// I/O addresses as in avr-libc iotnx5.h
+#if defined(__AVR_ATtiny25__)
+#define SIM_MCU "attiny25"
+#define SIM_EEPSIZE 128
+#elif defined(__AVR_ATtiny45__)
+#define SIM_MCU "attiny45"
+#define SIM_EEPSIZE 256
+#else
+#define SIM_MCU "attiny85"
+#define SIM_EEPSIZE 512
+#define SIM_EEARH  0x1F
+#endif
+#define SIM_OCR0B  0x28
+#define SIM_TCCR0A 0x2A
+#endif
+
+#define SIM_ADCH   0x05
+#define SIM_ADCSRA 0x06
+#define SIM_ADMUX  0x07
+#define SIM_DIDR0  0x14
+#define SIM_DDRB   0x17
+#define SIM_PORTB  0x18
+#define SIM_EECR   0x1C
+#define SIM_EEDR   0x1D
+#define SIM_EEARL  0x1E
+#define SIM_WDTCR  0x21
+#define SIM_TCCR0B 0x33
+#define SIM_MCUCR  0x35
+#define SIM_SREG   0x3F
+
+uint8_t sim_io_read(uint8_t addr);
+void sim_io_write(uint8_t addr, uint8_t value);
+void sim_delay_cycles(uint32_t cycles);
+void sim_sei();
+void sim_cli();
+void sim_sleep();
+void sim_wdt_reset();
+
+// Stands for one I/O register, so every access of firmware goes through the simulation
+class SimReg8 {
+public:
+	explicit SimReg8(uint8_t addr) : addr(addr) {}
+	operator uint8_t() const { return sim_io_read(addr); }
+	SimReg8 &operator=(uint8_t value) { sim_io_write(addr, value); return *this; }
+	SimReg8 &operator|=(uint8_t value) { sim_io_write(addr, sim_io_read(addr) | value); return *this; }
+	SimReg8 &operator&=(uint8_t value) { sim_io_write(addr, sim_io_read(addr) & value); return *this; }
+private:
+	uint8_t addr;
+};
+
+#endif  // SIM_H
@@ -0,0 +1,52 @@
+/*
+ * Source of rukolamp.dis - parser fixture of budget.py, not part of the firmware.
+ * Disassembly line info points here, so instructions of inlined functions are
+ * assigned to them (battcheck in main, eeprom_read in SaveStatusAndConfig).
+ */
+
+uint8_t eeprom_read(uint8_t address) {
+	EEARL = address;
+	EECR |= (1 << EERE);
+	return EEDR;
+}
+
+void SaveStatusAndConfig() {
+	uint8_t old = eeprom_read(EEPSIZE - 1);
+	if (old != config) {
+		do {} while (EECR & (1 << EEPE));
+	}
+}
+
+inline uint8_t battcheck() {
+	do {} while (ADCSRA & (1 << ADSC));
+	return pgm_read_byte(voltage_blinks);
+}
+
+uint8_t FuelGaugeBars(uint8_t fuel) {
+	while (fuel >= FUEL_PER_BAR) fuel -= FUEL_PER_BAR;
+	return fuel;
+}
+
+uint8_t ReadBand() {
+	uint8_t band = offtime_band; if (band) band = OFFTIME_SHORT;
+	if (band == OFFTIME_MEDIUM) band = OFFTIME_LONG;
+	return band;
+}
+
+#ifdef WDT_ISR_NAKED
+ISR(WDT_vect, ISR_NAKED) {
+#else
+ISR(WDT_vect) {
+#endif
+	SaveStatusAndConfig();
+}
+
+int main(void) {
+	DDRB |= (1 << PWM_PIN);
+	while (1) {
+		battcheck();
+		cli();
+		SaveStatusAndConfig();
+		sei();
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef SIM_UTIL_DELAY_BASIC_H
+#define SIM_UTIL_DELAY_BASIC_H
+/*
+ * Mock of avr-libc <util/delay_basic.h>
+ */
+
+#include "../sim.h"
+
+// 4 cycles per iteration, 0 means 65536 iterations
+inline void _delay_loop_2(uint16_t count) {
+	sim_delay_cycles(count ? 4UL * count : 4UL * 65536);
+}
+
+#endif  // SIM_UTIL_DELAY_BASIC_H
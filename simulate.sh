@@ -0,0 +1,28 @@
+#!/bin/bash
+# Host simulation of the firmware - runs rukolamp.c against mocked AVR headers (sim/avr)
+# and records pwm, ADC, EEPROM and watchdog activity of the scenario into VCD file for GTKWave.
+#
+# usage: ./simulate.sh <scenario> [output.vcd]
+#        MCU=attiny85 ./simulate.sh ...   simulate other processor (traits in targets.h)
+
+SCENARIO=${1:-sim/scenarios/lvp-autosave.txt}
+VCD=${2:-$(basename "$SCENARIO" .txt).vcd}
+
+MCU=${MCU:-attiny13a}
+case $MCU in
+	attiny13a) TARGET=__AVR_ATtiny13A__;;
+	attiny25)  TARGET=__AVR_ATtiny25__;;
+	attiny45)  TARGET=__AVR_ATtiny45__;;
+	attiny85)  TARGET=__AVR_ATtiny85__;;
+	*) echo "unsupported MCU $MCU"; exit 1;;
+esac
+
+CFLAGS="-Wall -W -Wno-attributes"
+CFLAGS+=" -g -O1"
+CFLAGS+=" -D$TARGET"
+CFLAGS+=" -funsigned-char"
+
+g++ $CFLAGS -Isim -Dmain=firmware_main -x c++ -c rukolamp.c -o rukolamp-sim.o || exit 1
+g++ $CFLAGS sim/sim.cpp rukolamp-sim.o -o rukolamp-sim || exit 1
+
+./rukolamp-sim "$SCENARIO" "$VCD"
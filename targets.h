@@ -0,0 +1,51 @@
+#ifndef TARGETS_H
+#define TARGETS_H
+/*
+ * Target traits - clock, EEPROM, ADC and timer parameters of supported processors.
+ * Processor is selected by -mmcu (compile.sh MCU=...), avr-gcc then defines __AVR_<part>__.
+ *
+ * Board related stuff (pins, PWM output register, voltage divider) stays in rukolamp.c,
+ * because all supported parts share the same pinout in 8-pin package.
+ */
+
+#if defined(__AVR_ATtiny13A__) || defined(__AVR_ATtiny13__)
+
+//ATtiny13A definitions
+#define F_CPU 4800000UL
+#define EEPSIZE 64
+#define V_REF REFS0
+#define BOGOMIPS 950
+#define ADC_PRSCL   0x05    // clk/32 (makes it 150kHz)
+#define EEPE EEWE //found out, that in avr-libc 1.8 there are different names of these two bits than in datasheet
+#define EEMPE EEMWE
+#define WDT_ISR_NAKED // WDT_vect saves registers by hand, list is taken from 13A disassembly (saves approx. 50 bytes)
+
+#elif defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+
+//ATtiny25/45/85 definitions - internal 8MHz RC oscillator (fuses Lo: 0xE2, Hi: 0xDF)
+#define F_CPU 8000000UL
+#if defined(__AVR_ATtiny25__)
+#define EEPSIZE 128
+#elif defined(__AVR_ATtiny45__)
+#define EEPSIZE 256
+#else
+#define EEPSIZE 256 // 85 has 512B, but firmware addresses eeprom only by EEARL
+#define CLEAR_EEARH // EEAR8 is undefined after reset, so it has to be cleared once at start
+#endif
+#define V_REF REFS1 // REFS2..0 = 010 is 1.1V internal reference
+#define BOGOMIPS 1583 // 950 scaled to 8MHz
+#define ADC_PRSCL   0x06    // clk/64 (makes it 125kHz)
+#ifndef WDTIE
+#define WDTIE WDIE
+#endif
+
+// plenty of flash, so everything optional is on and WDT_vect is ordinary ISR
+#define USE_FUEL_GAUGE
+#define USE_OFFTIME_BANDS
+#define EXTRA_LEVEL_GROUPS
+
+#else
+#error "Unsupported processor, see targets.h"
+#endif
+
+#endif  // TARGETS_H
@@ -0,0 +1,66 @@
+#!/bin/bash
+# Golden trace regression tests - builds host simulation of the firmware (see simulate.sh)
+# with address and undefined behaviour sanitizers, replays every scenario and compares
+# light output timeline with stored golden trace.
+#
+# Default 13A build is tested by sim/tests/*.txt, tiny85 build (fuel gauge and graded
+# clicks are on there, see targets.h) by sim/tests/attiny85/*.txt.
+#
+# budget.py parser is checked by saved objdump output of sim/tests/budget/rukolamp.elf
+# (its sources are in source.c there) against stored report.
+#
+# usage: ./test.sh            run all tests
+#        UPDATE=1 ./test.sh   regenerate golden traces (check the diff before committing!)
+
+CFLAGS="-Wall -W -Wno-attributes"
+CFLAGS+=" -g -O1"
+CFLAGS+=" -funsigned-char"
+CFLAGS+=" -fsanitize=address,undefined -fno-sanitize-recover=all -fno-omit-frame-pointer"
+
+FAILED=0
+for MCU in attiny13a attiny85; do
+	case $MCU in
+		attiny13a) TARGET=__AVR_ATtiny13A__; TESTS=sim/tests;;
+		attiny85)  TARGET=__AVR_ATtiny85__;  TESTS=sim/tests/attiny85;;
+	esac
+	OUT=_test/$MCU
+
+	mkdir -p $OUT || exit 1
+	g++ $CFLAGS -D$TARGET -Isim -Dmain=firmware_main -x c++ -c rukolamp.c -o $OUT/rukolamp-sim.o || exit 1
+	g++ $CFLAGS -D$TARGET sim/sim.cpp $OUT/rukolamp-sim.o -o $OUT/rukolamp-sim || exit 1
+
+	for SCENARIO in $TESTS/*.txt; do
+		NAME=$(basename "$SCENARIO" .txt)
+		GOLDEN=$TESTS/$NAME.trace
+		if ! $OUT/rukolamp-sim "$SCENARIO" $OUT/$NAME.vcd $OUT/$NAME.trace; then
+			echo "FAIL $MCU $NAME (simulation error)"
+			FAILED=1
+		elif [ -n "$UPDATE" ]; then
+			cp $OUT/$NAME.trace "$GOLDEN"
+			echo "UPDATED $MCU $NAME"
+		elif ! diff -u "$GOLDEN" $OUT/$NAME.trace > $OUT/$NAME.diff; then
+			echo "FAIL $MCU $NAME (see $OUT/$NAME.diff and $OUT/$NAME.vcd)"
+			FAILED=1
+		else
+			echo "ok   $MCU $NAME"
+		fi
+	done
+done
+
+BUDGET=sim/tests/budget
+mkdir -p _test/budget || exit 1
+if ! ./budget.py --baseline $BUDGET/rukolamp.budget --disassembly $BUDGET/rukolamp.dis --sections $BUDGET/rukolamp.sections \
+		$BUDGET/rukolamp.elf > _test/budget/rukolamp.report; then
+	echo "FAIL budget (budget.py error)"
+	FAILED=1
+elif [ -n "$UPDATE" ]; then
+	cp _test/budget/rukolamp.report $BUDGET/rukolamp.report
+	echo "UPDATED budget"
+elif ! diff -u $BUDGET/rukolamp.report _test/budget/rukolamp.report > _test/budget/rukolamp.diff; then
+	echo "FAIL budget (see _test/budget/rukolamp.diff)"
+	FAILED=1
+else
+	echo "ok   budget"
+fi
+
+exit $FAILED